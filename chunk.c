@@ -0,0 +1,140 @@
+#include <string.h>
+#include "types.h"
+#include "chunk.h"
+
+/**
+ * A small LZ77 codec for packed image chunks. A chunk is a list of sequences
+ *
+ *   varint(literal length) literals varint(match length - MINMATCH) varint(offset)
+ *
+ * and the last sequence has only its literals.
+ */
+
+/** MACROS */
+#define MINMATCH  4   // shortest match worth encoding
+#define HASHBITS  14  // log2 of the match finder table size
+#define HASH(p)   ((((p)[0] | (p)[1] << 8 | (p)[2] << 16 | (uint) (p)[3] << 24) * 2654435761u) >> (32 - HASHBITS))
+
+/**
+ * @return length of v written as a varint at dst, or 0 if it does not fit before end
+ */
+static uint
+put_varint(uchar *dst, uchar *end, uint v)
+{
+  uchar *p = dst;
+  do {
+    if (p == end)
+      return 0;
+    *p++ = (v & 0x7F) | (v > 0x7F ? 0x80 : 0);
+    v >>= 7;
+  } while (v);
+  return p - dst;
+}
+
+/**
+ * @return length of the varint read from src into *v, or 0 if it is cut short before end
+ */
+static uint
+get_varint(const uchar *src, const uchar *end, uint *v)
+{
+  const uchar *p = src;
+  uint shift = 0;
+  *v = 0;
+  while (p < end && shift < 32) {
+    *v |= (uint) (*p & 0x7F) << shift;
+    if (!(*p++ & 0x80))
+      return p - src;
+    shift += 7;
+  }
+  return 0;
+}
+
+/**
+ * @return length of the sequence written at dst, or 0 if it does not fit before end
+ */
+static uint
+put_sequence(uchar *dst, uchar *end, const uchar *lit, uint nlit, uint mlen, uint off)
+{
+  uchar *p = dst;
+  uint k;
+  if ((k = put_varint(p, end, nlit)) == 0 || (uint) (end - (p + k)) < nlit)
+    return 0;
+  p += k;
+  memcpy(p, lit, nlit);
+  p += nlit;
+  if (mlen == 0)
+    return p - dst;
+  if ((k = put_varint(p, end, mlen - MINMATCH)) == 0)
+    return 0;
+  p += k;
+  if ((k = put_varint(p, end, off)) == 0)
+    return 0;
+  return p + k - dst;
+}
+
+uint
+chunk_compress(const uchar *src, uint n, uchar *dst, uint cap)
+{
+  int table[1 << HASHBITS];
+  uint ip = 0, anchor = 0, len, k, out = 0;
+  int cand;
+
+  memset(table, 0xFF, sizeof(table));
+  while (ip + MINMATCH <= n)
+  {
+    uint h = HASH(src + ip);
+    cand = table[h];
+    table[h] = ip;
+    if (cand < 0 || memcmp(src + cand, src + ip, MINMATCH) != 0) {
+      ip++;
+      continue;
+    }
+    // greedily extend the match, it may overlap the current position
+    for (len = MINMATCH; ip + len < n && src[cand + len] == src[ip + len]; len++)
+      ;
+    if ((k = put_sequence(dst + out, dst + cap, src + anchor, ip - anchor, len, ip - cand)) == 0)
+      return 0;
+    out += k;
+    ip += len;
+    anchor = ip;
+  }
+  if ((k = put_sequence(dst + out, dst + cap, src + anchor, n - anchor, 0, 0)) == 0)
+    return 0;
+  return out + k;
+}
+
+int
+chunk_decompress(const uchar *src, uint n, uchar *dst, uint cap)
+{
+  const uchar *ip = src, *iend = src + n;
+  uchar *op = dst, *oend = dst + cap;
+  uint nlit, mlen, off, k;
+
+  for (;;)
+  {
+    // literals
+    if ((k = get_varint(ip, iend, &nlit)) == 0)
+      return -1;
+    ip += k;
+    if (nlit > (uint) (iend - ip) || nlit > (uint) (oend - op))
+      return -1;
+    memcpy(op, ip, nlit);
+    ip += nlit;
+    op += nlit;
+    if (op == oend)
+      return 0;
+
+    // match, copied byte by byte as it may overlap its own output
+    if ((k = get_varint(ip, iend, &mlen)) == 0)
+      return -1;
+    ip += k;
+    if ((k = get_varint(ip, iend, &off)) == 0)
+      return -1;
+    ip += k;
+    mlen += MINMATCH;
+    if (off == 0 || off > (uint) (op - dst) || mlen > (uint) (oend - op))
+      return -1;
+    for (k = 0; k < mlen; k++, op++)
+      *op = *(op - off);
+  }
+}
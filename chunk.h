@@ -0,0 +1,40 @@
+#ifndef _CHUNK_H_
+#define _CHUNK_H_
+
+// Packed file system image format.
+// Written by pack, read directly by fcheck.
+
+// The image is split into chunks of chunkblocks blocks, each compressed
+// on its own so any chunk can be inflated without touching the others.
+//
+// [chunkhdr][chunkent * nchunks][compressed chunks ...]
+
+#define CHUNK_MAGIC 0x315A5658  // "XVZ1"
+#define CHUNK_BLOCKS 64         // default blocks per chunk
+#define CHUNK_MAXBLOCKS ((1 << 24) / BSIZE)  // largest chunk, 16MB
+
+struct chunkhdr {
+  uint magic;        // CHUNK_MAGIC
+  uint chunkblocks;  // Blocks per chunk
+  uint nblocks;      // Size of the unpacked image (blocks)
+  uint nchunks;      // Number of chunks
+};
+
+// Chunk index entry.
+// len == 0 means an all zero chunk, len equal to the unpacked size of the
+// chunk means it is stored uncompressed.
+struct chunkent {
+  unsigned long long off;  // Offset of the chunk in the packed file
+  uint len;                // Length of the chunk in the packed file
+  uint pad;
+};
+
+// Compress n bytes of src into dst, which holds cap bytes.
+// Returns the compressed length, or 0 if it does not fit.
+uint chunk_compress(const uchar *src, uint n, uchar *dst, uint cap);
+
+// Inflate n bytes of src into exactly cap bytes of dst.
+// Returns 0 on success, -1 if src is corrupt.
+int chunk_decompress(const uchar *src, uint n, uchar *dst, uint cap);
+
+#endif // _CHUNK_H_
@@ -6,9 +6,12 @@
 #include <stdbool.h>
 #include "types.h"
 #include "fs.h"
+#include "chunk.h"
 
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <pthread.h>
 
 /** MACROS */
 #define BLOCK_SIZE (BSIZE) // Block size of FS
@@ -17,6 +20,12 @@
 #define T_FILE     2   // File
 #define T_DEV      3   // Special device
 #define DIRENTPB   (BSIZE / sizeof(struct dirent)) // number of directory entries in a block
+#define CHECK(c)   (0x1 << (c)) // bit for condition c in a set of checks
+#define CHECKS_ALL     (0x1FFE) // conditions 1 to 12
+#define CHECKS_INODES  (CHECK(1) | CHECK(2) | CHECK(3)) // inode and root structure
+#define CHECKS_BLOCKS  (CHECK(5) | CHECK(6) | CHECK(7) | CHECK(8)) // block bitmap consistency
+#define CHECKS_NAMES   (CHECK(4) | CHECKS_REFS) // namespace integrity
+#define CHECKS_REFS    (CHECK(9) | CHECK(10) | CHECK(11) | CHECK(12)) // references to inodes
 #define BIT(addr, blocknum, ninodes) ((*(addr + (BBLOCK(blocknum,ninodes) * BLOCK_SIZE) + blocknum / BYTE)) & (0x1 << (blocknum % BYTE))) // return the value of bitmap for given block num 
 
 /** Global variables */
@@ -27,12 +36,214 @@ uint bitblocks, usedblocks, totalblocks, freeblock; // aggregate values of diffe
 struct superblock *sb; // superblock
 struct dinode *dip;    // pointer to inode struct
 struct dirent *de;     // pointer to directory entry struct
+off_t imgsize;         // size of the image file in bytes
+
+/**
+ * @return struct pointer to inode i
+ */
+struct dinode* 
+inode(int i)
+{
+    struct dinode* ip = (struct dinode *) (addr + IBLOCK((uint) i)*BLOCK_SIZE);
+    ip += (i)%IPB;
+    return ip;
+}
+
+/** Packed images */
+uchar *packed;             // memory address of memory mapped packed image
+struct chunkhdr *hdr;      // header of the packed image
+struct chunkent *chunks;   // chunk index of the packed image
+bool *wanted;              // chunks queued for inflation at some point
+uint *work, nwork, next;   // chunks queued for the next round of inflation
+pthread_mutex_t worklock = PTHREAD_MUTEX_INITIALIZER;
+bool corrupt;              // set by a worker if a chunk does not inflate, under worklock
+
+/**
+ * @brief Inflate chunk k of the packed image in place in the image mapping
+ */
+bool 
+inflate_chunk(uint k)
+{
+  uint len = hdr->chunkblocks * BLOCK_SIZE;
+  if ((unsigned long long) (k + 1) * hdr->chunkblocks > hdr->nblocks)
+    len = (hdr->nblocks - k * hdr->chunkblocks) * BLOCK_SIZE;
+  uchar *dst = (uchar *) addr + (off_t) k * hdr->chunkblocks * BLOCK_SIZE;
+  uchar *src = packed + chunks[k].off;
+
+  if (chunks[k].len == 0)       // all zero, the anonymous mapping already is
+    return true;
+  if (chunks[k].len == len) {   // stored uncompressed
+    memcpy(dst, src, len);
+    return true;
+  }
+  return chunk_decompress(src, chunks[k].len, dst, len) == 0;
+}
+
+/**
+ * @brief Worker: inflate chunks from the work list until it is empty
+ */
+void* 
+inflate_worker(void *arg)
+{
+  uint k;
+  for (;;) 
+  {
+    pthread_mutex_lock(&worklock);
+    k = next < nwork ? work[next++] : (uint) -1;
+    pthread_mutex_unlock(&worklock);
+    if (k == (uint) -1)
+      return NULL;
+    if (!inflate_chunk(k)) {
+      pthread_mutex_lock(&worklock);
+      corrupt = true;
+      pthread_mutex_unlock(&worklock);
+    }
+  }
+}
+
+/**
+ * @brief Queue the chunk holding block b for inflation unless it already was,
+ *        nothing to do for plain images
+ */
+void 
+want_block(uint b)
+{
+  if (hdr && b < hdr->nblocks && !wanted[b / hdr->chunkblocks]) {
+    wanted[b / hdr->chunkblocks] = true;
+    work[nwork++] = b / hdr->chunkblocks;
+  }
+}
+
+/**
+ * @brief Inflate the chunks queued since the last round, in parallel
+ */
+void 
+inflate_wanted()
+{
+  uint k, nthreads;
+  pthread_t threads[64];
+
+  if (!hdr || nwork == 0)
+    return;
+  next = 0;
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  nthreads = ncpu < 1 ? 1 : ncpu > 64 ? 64 : ncpu;
+  if (nthreads > nwork)
+    nthreads = nwork;
+  // the main thread is one of the workers
+  for (k = 0; k + 1 < nthreads; k++) 
+  {
+    if (pthread_create(&threads[k], NULL, inflate_worker, NULL) != 0)
+      break;
+  }
+  nthreads = k;
+  inflate_worker(NULL);   // finishes the work if no thread started
+  for (k = 0; k < nthreads; k++)
+    pthread_join(threads[k], NULL);
+  nwork = next = 0;
+  if (corrupt) {
+    fprintf(stderr, "ERROR: bad packed image.\n");
+    exit(1);
+  }
+}
+
+/**
+ * @brief Map a packed image. The unpacked image is an anonymous mapping that stays
+ *        zero except for the chunks the selected checks read: the superblock, inode
+ *        table, the bitmap for [5] and [6], indirect blocks, and directory blocks only
+ *        when a namespace check runs. Data chunks are never inflated. When lazy, directory blocks are
+ *        left for sample_directory to inflate and the mapping stays writable.
+ */
+void 
+load_packed(int fsfd, off_t size, uint checks, bool lazy)
+{
+  uint k, n;
+  packed = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fsfd, 0);
+  if (packed == MAP_FAILED){
+    perror("mmap failed");
+    exit(1);
+  }
+  hdr = (struct chunkhdr *) packed;
+  chunks = (struct chunkent *) (packed + sizeof(struct chunkhdr));
+  if (size < sizeof(struct chunkhdr) || hdr->chunkblocks == 0 ||
+      hdr->chunkblocks > CHUNK_MAXBLOCKS || hdr->nblocks == 0 ||
+      hdr->nchunks != (hdr->nblocks - 1) / hdr->chunkblocks + 1 ||
+      sizeof(struct chunkhdr) + (off_t) hdr->nchunks * sizeof(struct chunkent) > size) {
+    fprintf(stderr, "ERROR: bad packed image.\n");
+    exit(1);
+  }
+  for (k = 0; k < hdr->nchunks; k++) 
+  {
+    if (chunks[k].off > (unsigned long long) size || chunks[k].len > size - chunks[k].off) {
+      fprintf(stderr, "ERROR: bad packed image.\n");
+      exit(1);
+    }
+  }
+
+  imgsize = (off_t) hdr->nblocks * BLOCK_SIZE;
+  addr = mmap(NULL, imgsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (addr == MAP_FAILED){
+    perror("mmap failed");
+    exit(1);
+  }
+  wanted = (bool *) calloc(hdr->nchunks, sizeof(bool));
+  work = (uint *) malloc(sizeof(uint) * hdr->nchunks);
+
+  // superblock
+  want_block(1);
+  inflate_wanted();
+
+  // inode table, and the bitmap only for [5] and [6]
+  sb = (struct superblock *) (addr + 1 * BLOCK_SIZE);
+  uint meta = sb->ninodes / IPB + 3;
+  if (checks & (CHECK(5) | CHECK(6)))
+    meta += sb->size / BPB + 1;
+  for (k = 0; k < meta && k < hdr->nblocks; k++)
+    want_block(k);
+  inflate_wanted();
+
+  // indirect blocks, directory blocks, and the first block of root
+  bool indirect = checks & (CHECK(2) | CHECK(5) | CHECK(6) | CHECK(8));
+  bool names = (checks & CHECKS_NAMES) && !lazy;
+  uint ninodes = sb->ninodes;
+  if (ninodes > (hdr->nblocks - 2) * IPB)
+    ninodes = (hdr->nblocks - 2) * IPB;
+  if ((checks & CHECK(3)) && ROOTINO < ninodes)
+    want_block(inode(ROOTINO)->addrs[0]);
+  for (i = ROOTINO, dip = inode(i); i < ninodes; i++, dip++) 
+  {
+    if (dip->type == 0)
+      continue;
+    if (indirect || (names && dip->type == T_DIR))
+      want_block(dip->addrs[NDIRECT]);
+    if (names && dip->type == T_DIR)
+      for (n = 0; n < NDIRECT; n++)
+        want_block(dip->addrs[n]);
+  }
+  inflate_wanted();
+
+  // directory blocks held in indirect blocks
+  for (i = ROOTINO, dip = inode(i); names && i < ninodes; i++, dip++) 
+  {
+    if (dip->type != T_DIR || dip->addrs[NDIRECT] == 0 || dip->addrs[NDIRECT] >= hdr->nblocks)
+      continue;
+    uint* addrs = (uint*) (addr + dip->addrs[NDIRECT] * BLOCK_SIZE);
+    for (n = 0; n < NINDIRECT; n++)
+      want_block(addrs[n]);
+  }
+  inflate_wanted();
+
+  if (!lazy && mprotect(addr, imgsize, PROT_READ) != 0) {
+    perror("mprotect failed");
+    exit(1);
+  }
+}
 
 /**
  * @brief: Initialize the file system checker
  */
 void 
-init(char* image) 
+init(char* image, uint checks, bool lazy) 
 {
   // open fd for given image file
   int fsfd = open(image, O_RDONLY);
@@ -48,11 +259,17 @@ init(char* image)
     exit(1);
   }
 
-  // memory map the file system
-  addr = mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fsfd, 0);
-  if (addr == MAP_FAILED){
-    perror("mmap failed");
-    exit(1);
+  // packed images are inflated on demand, plain ones are memory mapped as they are
+  uint magic = 0;
+  if (pread(fsfd, &magic, sizeof(magic), 0) == sizeof(magic) && magic == CHUNK_MAGIC) {
+    load_packed(fsfd, buf.st_size, checks, lazy);
+  } else {
+    imgsize = buf.st_size;
+    addr = mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fsfd, 0);
+    if (addr == MAP_FAILED){
+      perror("mmap failed");
+      exit(1);
+    }
   }
 
   // read the super block
@@ -63,17 +280,6 @@ init(char* image)
   freeblock = usedblocks;
 }
 
-/**
- * @return struct pointer to inode i
- */
-struct dinode* 
-inode(int i)
-{
-    struct dinode* ip = (struct dinode *) (addr + IBLOCK((uint) i)*BLOCK_SIZE);
-    ip += (i)%IPB;
-    return ip;
-}
-
 /**
  * @brief: [1] Each inode is either unallocated or one of the valid types
  */
@@ -161,6 +367,11 @@ valid_root()
       exit(1);
     }
 
+    if (!valid_data_block(dip->addrs[0]))
+    {
+      fprintf(stderr, "ERROR: root directory does not exist.\n");
+      exit(1);
+    }
     de = (struct dirent *) (addr + (dip->addrs[0])*BLOCK_SIZE);
     for (i = 0; i < DIRENTPB; i++,de++){
       if (de) {
@@ -178,303 +389,434 @@ valid_root()
   }
 }
 
+/**
+ * @brief Feed the entries of block blocknum of directory dinum to the selected checks
+ *        [4] counts '.' and '..' into *dots, '.' must refer to dinum
+ *        [9]-[12] counts the references to each inode into ref, and sets *badref for
+ *        an entry referring to an inode number past the inode table
+ */
+static inline __attribute__((always_inline)) void 
+scan_dir_block(const uint checks, uint dinum, uint blocknum, int* dots, uint* ref, bool* badref)
+{
+  struct dirent* e = (struct dirent *) (addr + blocknum*BLOCK_SIZE);
+  uint k;
+  for (k = 0; k < DIRENTPB; k++, e++)
+  {
+    if (strcmp(e->name, ".") == 0) {
+      // "." should map to current inode
+      if ((checks & CHECK(4)) && ++(*dots) && e->inum != dinum)
+      {
+        fprintf(stderr, "ERROR: directory not properly formatted.\n");
+        exit(1);
+      }
+      continue;
+    }
+    if (strcmp(e->name, "..") == 0) {
+      (*dots)++;
+      continue;
+    }
+    if (checks & CHECKS_REFS) {
+      if (e->inum >= sb->ninodes)
+        *badref = true;
+      else
+        ref[e->inum]++; // update reference count
+    }
+  }
+}
+
 /**
  * @brief [4] Each directory has '.' with reference to itself and ".." to its parent
+ *        One pass over all directory entries, which also counts the references to each
+ *        inode when any of [9]-[12] is selected, for valid_names to check later
+ * @return references to each inode, or NULL if none of [9]-[12] is selected
  */
-void 
-valid_directory()
+static inline __attribute__((always_inline)) uint* 
+scan_names(const uint checks, bool* badref)
 {
-  // over all inodes
+  uint* ref = NULL;
+  int dots;
+  if (checks & CHECKS_REFS)
+    ref = (uint*) calloc(sb->ninodes, sizeof(uint));
+
+  // over all directories
   for (i = ROOTINO, dip = inode(i); i < sb->ninodes; i++, dip++) 
   {
-    if (dip && dip->type) 
+    if (dip->type != T_DIR)
+      continue;
+    // counts instances of . and ..
+    dots = 0;
+    for (n = 0; n < NDIRECT; n++) 
     {
-      // ones which are directory
-      if (dip->type == T_DIR) {
-        // flag to count instances of . and ..
-        flag = 0;
-        // reading all direct blocks for directory entries
-        for (n = 0; n < NDIRECT; n++) 
-        {
-          if ((blocknum = dip->addrs[n]) != 0)
-          {
-            de = (struct dirent *) (addr + blocknum*BLOCK_SIZE);
-            for (j = 0; j < DIRENTPB; j++,de++){
-              // "." should map to current inode
-              if (strcmp(de->name, ".") == 0 && ++flag && de->inum != i)
-              {
-                fprintf(stderr, "ERROR: directory not properly formatted.\n" );
-                exit(1);
-              }
-              if (strcmp(de->name, "..") == 0) flag++;
-            }
-          }
-        }
-        if ((blocknum = dip->addrs[NDIRECT]) != 0) 
-        {
-          uint* addrs = (uint*) (addr + blocknum * BLOCK_SIZE);
-          for (n = 0; n < NINDIRECT; n++) 
-          {
-            if ((blocknum = addrs[n]) != 0)
-            {
-              de = (struct dirent *) (addr + blocknum*BLOCK_SIZE);
-              for (j = 0; j < DIRENTPB; j++,de++){
-                // "." should map to current inode
-                if (strcmp(de->name, ".") == 0 && ++flag && de->inum != i)
-                {
-                  fprintf(stderr, "ERROR: directory not properly formatted.\n" );
-                  exit(1);
-                }
-                if (strcmp(de->name, "..") == 0) flag++;
-              }
-            }
-          }
-        }
-        if (flag != 2) {
-          fprintf(stderr, "ERROR: directory not properly formatted.\n");
-          exit(1);
-        }
+      if ((blocknum = dip->addrs[n]) != 0 && valid_data_block(blocknum))
+        scan_dir_block(checks, i, blocknum, &dots, ref, badref);
+    }
+    if ((blocknum = dip->addrs[NDIRECT]) != 0 && valid_data_block(blocknum)) 
+    {
+      uint* addrs = (uint*) (addr + blocknum * BLOCK_SIZE);
+      for (n = 0; n < NINDIRECT; n++) 
+      {
+        if ((blocknum = addrs[n]) != 0 && valid_data_block(blocknum))
+          scan_dir_block(checks, i, blocknum, &dots, ref, badref);
       }
     }
+    if ((checks & CHECK(4)) && dots != 2) {
+      fprintf(stderr, "ERROR: directory not properly formatted.\n");
+      exit(1);
+    }
   }
+  return ref;
 }
 
 /**
  * @brief [5] For in-use inodes, each block address in use is also marked in use in the bitmap
  *        [6] For blocks marked in-use  in bitmap, the block should actually be in-use in an inode
  *        or indirect block somewhere
+ *        [7] For in-use inodes, each direct address in use is only used once
+ *        [8] For in-use inodes, each indirect address in use is only used once
+ *        One pass over all inodes feeds the selected checks.
  */
-void 
-valid_bitmap_mark() 
+static inline __attribute__((always_inline)) void 
+valid_blocks(const uint checks) 
 {
-  bool* marked = (bool*) malloc(sizeof(bool) * sb->nblocks);
-  bool* inuse = (bool*) malloc(sizeof(bool) * sb->nblocks);
+  bool* marked = NULL;    // [5][6] blocks marked in bitmap
+  bool* inuse = NULL;     // [5][6] blocks used by inodes
+  bool* direct = NULL;    // [7] blocks used as direct blocks
+  bool* indirect = NULL;  // [8] blocks used from indirect blocks
+  bool dupdirect = false, dupindirect = false;
 
-  // Flag all the blocks which have been marked in bitmap
-  for (i = freeblock; i < totalblocks; i++) 
-  {
-    if (BIT(addr, i, sb->ninodes))
-      marked[i - freeblock] = true;
+  if (checks & (CHECK(5) | CHECK(6))) {
+    marked = (bool*) calloc(sb->nblocks, sizeof(bool));
+    inuse = (bool*) calloc(sb->nblocks, sizeof(bool));
+    // Flag all the blocks which have been marked in bitmap
+    for (i = freeblock; i < totalblocks; i++) 
+    {
+      if (BIT(addr, i, sb->ninodes))
+        marked[i - freeblock] = true;
+    }
   }
+  if (checks & CHECK(7))
+    direct = (bool*) calloc(sb->nblocks, sizeof(bool));
+  if (checks & CHECK(8))
+    indirect = (bool*) calloc(sb->nblocks, sizeof(bool));
 
   for (i = ROOTINO, dip = inode(i); i < sb->ninodes; i++, dip++) 
   {
-    // flag all block address used in inodes
-    if (dip && dip->type) 
+    if (!dip->type)
+      continue;
+    for (n = 0; n < NDIRECT; n++) 
     {
-      for (n = 0; n < NDIRECT + 1; n++) 
+      if ((blocknum = dip->addrs[n]) != 0 && valid_data_block(blocknum))
       {
-        if ((blocknum = dip->addrs[n]) != 0)
+        if (checks & (CHECK(5) | CHECK(6)))
           inuse[blocknum - freeblock] = true;
+        // any block can have utmost one reference
+        if (checks & CHECK(7)) {
+          dupdirect |= direct[blocknum - freeblock];
+          direct[blocknum - freeblock] = true;
+        }
       }
-      if (blocknum) {
-        uint* addrs = (uint*) (addr + blocknum * BLOCK_SIZE);
-        for (n = 0; n < NINDIRECT; n++) 
+    }
+    if (!(checks & (CHECK(5) | CHECK(6) | CHECK(8))))
+      continue;
+    if ((blocknum = dip->addrs[NDIRECT]) != 0 && valid_data_block(blocknum)) 
+    {
+      if (checks & (CHECK(5) | CHECK(6)))
+        inuse[blocknum - freeblock] = true;
+      uint* addrs = (uint*) (addr + blocknum * BLOCK_SIZE);
+      for (n = 0; n < NINDIRECT; n++) 
+      {
+        if ((blocknum = addrs[n]) != 0 && valid_data_block(blocknum))
         {
-          if ((blocknum = addrs[n]) != 0)
+          if (checks & (CHECK(5) | CHECK(6)))
             inuse[blocknum - freeblock] = true;
+          // any block can have utmost one reference
+          if (checks & CHECK(8)) {
+            dupindirect |= indirect[blocknum - freeblock];
+            indirect[blocknum - freeblock] = true;
+          }
         }
       }
     }
   }
-  for (i = 0; i < totalblocks - freeblock; i++) 
+
+  for (i = 0; (checks & (CHECK(5) | CHECK(6))) && i < totalblocks - freeblock; i++) 
   {
     // not marked in bitmap but used  in inode
-    if (inuse[i] && !marked[i])
+    if ((checks & CHECK(5)) && inuse[i] && !marked[i])
     {
       fprintf(stderr, "ERROR: address used by inode but marked free in bitmap.\n");
       exit(1);
     }
     // marked in bitmap but used nowhere in inodes
-    if (marked[i] && !inuse[i])
+    if ((checks & CHECK(6)) && marked[i] && !inuse[i])
     {
       fprintf(stderr, "ERROR: bitmap marks block in use but it is not in use.\n");
       exit(1);
     }
   }
+  if ((checks & CHECK(7)) && dupdirect) {
+    fprintf(stderr, "ERROR: direct address used more than once.\n");
+    exit(1);
+  }
+  if ((checks & CHECK(8)) && dupindirect) {
+    fprintf(stderr, "ERROR: indirect address used more than once.\n");
+    exit(1);
+  }
+  free(marked);
+  free(inuse);
+  free(direct);
+  free(indirect);
 }
 
 /**
- * @brief [7] For in-use inodes, each direct address in use is only used once
+ * @brief Check the references counted by scan_names
+ *        [9] For all inodes marked in use, each must be referred to in at least one directory
+ *        [10] For each inode number that is referred to in a valid directory, it is actually
+ *        marked in use
+ *        [11] Reference counts(number of links) for regular files match the number of times
+ *        file is referred to in directories (i.e., hard links work correctly)
+ *        [12] No extra links allowed for directories (each directory only appears in one other
+ *        directory)
  */
-void 
-valid_direct_address()
+static inline __attribute__((always_inline)) void 
+valid_names(const uint checks, uint* ref, bool badref)
 {
-  // counters for reference to data blocks
-  uint* count = (uint*) malloc(sizeof(uint) * sb->nblocks);
-  for (i = ROOTINO, dip = inode(i); i < sb->ninodes; i++, dip++) 
-  {
-    if (dip && dip->type) 
+  if (checks & (CHECK(9) | CHECK(10))) {
+    // an inode number past the inode table can not be in use
+    if ((checks & CHECK(10)) && badref) {
+      fprintf(stderr, "ERROR: inode referred to in directory but marked free.\n");
+      exit(1);
+    }
+    for (i = ROOTINO, dip = inode(i); i < sb->ninodes; i++, dip++)
     {
-      for (n = 0; n < NDIRECT; n++) 
-      {
-        if ((blocknum = dip->addrs[n]) != 0)
-        {
-          count[blocknum - freeblock]++;
-          // any block can have utmost one reference
-          if (count[blocknum - freeblock] > 1) {
-            fprintf(stderr, "ERROR: direct address used more than once.\n");
-            exit(1);
-          }
-        }
+      bool inuse = i == ROOTINO || ref[i] > 0; // root inode has to be used bruh
+      // used by inode but not marked in bitmap 
+      if ((checks & CHECK(10)) && inuse && !dip->type) {
+        fprintf(stderr, "ERROR: inode referred to in directory but marked free.\n");
+        exit(1);
+      }
+      // marked in bitmap but used nowhere in inodes
+      if ((checks & CHECK(9)) && !inuse && dip->type) {
+        fprintf(stderr, "ERROR: inode marked use but not found in directory.\n");
+        exit(1);
       }
     }
   }
+  for (i = ROOTINO, dip = inode(i); (checks & CHECK(11)) && i < sb->ninodes; i++, dip++) 
+  {
+    // check for mismatch in link count and reference count
+    if (dip->type == T_FILE && ref[i] != (uint) dip->nlink) 
+    {
+      fprintf(stderr, "ERROR: bad reference count for file.\n");
+      exit(1);
+    }
+  }
+  for (i = ROOTINO, dip = inode(i); (checks & CHECK(12)) && i < sb->ninodes; i++, dip++) 
+  {
+    // a directory should be mapped only once throughout fs
+    if (dip->type == T_DIR && ref[i] > 1) 
+    {
+      fprintf(stderr, "ERROR: directory appears more than once in filesystem.\n");
+      exit(1);
+    }
+  }
+  free(ref);
 }
 
 /**
- * @brief [8] For in-use inodes, each indirect address in use is only used once
+ * @brief Superblock sanity: the layout it describes fits inside the image file
  */
 void 
-valid_indirect_address()
+valid_superblock()
 {
-  // counters for data blocks used in indirect references
-  uint* count = (uint*) malloc(sizeof(uint) * sb->nblocks);
-  for (i = ROOTINO, dip = inode(i); i < sb->ninodes; i++, dip++) 
+  if (imgsize < 2 * BLOCK_SIZE || sb->ninodes <= ROOTINO || sb->nblocks == 0 ||
+      totalblocks > sb->size || (off_t) sb->size * BLOCK_SIZE > imgsize)
   {
-    if (dip && dip->type && (blocknum = dip->addrs[NDIRECT]) != 0) 
-    {
-      uint* addrs = (uint*) (addr + blocknum * BLOCK_SIZE);
-      for (n = 0; n < NINDIRECT; n++) 
-      {
-        if ((blocknum = addrs[n]) != 0)
-        {
-          count[blocknum - freeblock]++;
-          // any block can have utmost one reference
-          if (count[blocknum - freeblock] > 1) {
-            fprintf(stderr, "ERROR: indirect address used more than once.\n");
-            exit(1);
-          }
-        }
-      }
-    }
+    fprintf(stderr, "ERROR: bad superblock.\n");
+    exit(1);
   }
 }
 
+/** Budgeted sampling */
+unsigned long long seed;   // seed of the sampling order, printed so a run can be replayed
+uint* dirs;                // inode numbers of all directories, shuffled into sampling order
+uint ndirs, sampled;       // number of directories and how many of them were checked
+uint dirblocks, seenblocks;  // directory data blocks in total and in sampled directories
+uint* ref;                 // references to each inode found in sampled directories
+
 /**
- * @brief [9] For all inodes marked in use, each must be referred to in at least one directory
- *        [10] For each inode number that is referred to in a valid directory, it is actually marked
- *        in use
+ * @return next value of a splitmix64 generator, identical on every platform for a given seed
  */
-void 
-valid_inode_mark()
+unsigned long long 
+next_random()
+{
+  unsigned long long z = (seed += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+/**
+ * @return milliseconds elapsed on a monotonic clock
+ */
+double 
+now_ms()
 {
-  // flags for marked in inode bitmap
-  bool* mark = (bool*) malloc(sizeof(uint) * sb->ninodes);
-  // flags for used in inodes
-  bool* inuse = (bool*) malloc(sizeof(bool) * sb->ninodes);
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
 
-  inuse[ROOTINO] = true; // root inode has to be used bruh
+/**
+ * @return number of data blocks held by directory inode ip
+ */
+uint 
+count_dir_blocks(struct dinode* ip)
+{
+  uint k, count = 0;
+  for (k = 0; k < NDIRECT; k++)
+    if (ip->addrs[k])
+      count++;
+  if (ip->addrs[NDIRECT]) {
+    uint* addrs = (uint*) (addr + ip->addrs[NDIRECT] * BLOCK_SIZE);
+    for (k = 0; k < NINDIRECT; k++)
+      if (addrs[k])
+        count++;
+  }
+  return count;
+}
+
+/**
+ * @brief Collect every directory inode and shuffle them into a seeded sampling order
+ */
+void 
+sample_init()
+{
+  uint k, r, tmp;
+  dirs = (uint*) malloc(sizeof(uint) * sb->ninodes);
+  ref = (uint*) calloc(sb->ninodes, sizeof(uint));
+  ndirs = sampled = dirblocks = seenblocks = 0;
   for (i = ROOTINO, dip = inode(i); i < sb->ninodes; i++, dip++) 
   {
-    if (dip && dip->type) 
-    {
-      mark[i] = true; // mark as allocated in bitmap
-      if (dip->type == T_DIR) {
-        for (n = 0; n < NDIRECT; n++) 
-        {
-          if ((blocknum = dip->addrs[n]) != 0)
-          {
-            de = (struct dirent *) (addr + blocknum*BLOCK_SIZE);
-            for (j = 0; j < DIRENTPB; j++,de++){
-              if (!de || strcmp(".", de->name) == 0 || strcmp("..", de->name) == 0)
-                continue;
-              inuse[de->inum] = true; // mark as allocated to inode
-            }
-          }
-        }
-        if ((blocknum = dip->addrs[NDIRECT]) != 0) 
-        {
-          uint* addrs = (uint*) (addr + blocknum * BLOCK_SIZE);
-          for (n = 0; n < NINDIRECT; n++) 
-          {
-            if ((blocknum = addrs[n]) != 0)
-            {
-              de = (struct dirent *) (addr + blocknum*BLOCK_SIZE);
-              for (j = 0; j < DIRENTPB; j++,de++){
-                if (!de || strcmp(".", de->name) == 0 || strcmp("..", de->name) == 0)
-                  continue;
-                inuse[de->inum] = true; // mark as allocated to inode
-              }
-            }
-          }
-        }
-      }
+    if (dip->type == T_DIR) {
+      dirs[ndirs++] = i;
+      dirblocks += count_dir_blocks(dip);
     }
   }
-  for (i = ROOTINO; i < sb->ninodes; i++)
+  // Fisher-Yates shuffle
+  for (k = ndirs; k > 1; k--) 
+  {
+    r = next_random() % k;
+    tmp = dirs[k - 1];
+    dirs[k - 1] = dirs[r];
+    dirs[r] = tmp;
+  }
+}
+
+/**
+ * @brief Check the entries of one block of sampled directory dinum.
+ *        [4] counts '.' and '..' into *dots, '.' must refer to dinum
+ *        [10] each referenced inode must be in use
+ *        [11] a file can not be referenced more often than its link count
+ *        [12] a directory can not be referenced from more than one directory
+ */
+void 
+sample_dir_block(uint dinum, uint block, int* dots)
+{
+  struct dinode* ip;
+  struct dirent* e = (struct dirent *) (addr + block*BLOCK_SIZE);
+  uint k;
+  for (k = 0; k < DIRENTPB; k++, e++) 
   {
-    // used by inode but not marked in bitmap 
-    if (inuse[i] && !mark[i]) {
+    if (strcmp(e->name, ".") == 0 && ++(*dots) && e->inum != dinum)
+    {
+      fprintf(stderr, "ERROR: directory not properly formatted.\n");
+      exit(1);
+    }
+    if (strcmp(e->name, "..") == 0) {
+      (*dots)++;
+      continue;
+    }
+    if (strcmp(e->name, ".") == 0 || e->inum == 0)
+      continue;
+    if (e->inum >= sb->ninodes || (ip = inode(e->inum))->type == 0) {
       fprintf(stderr, "ERROR: inode referred to in directory but marked free.\n");
       exit(1);
     }
-    // marked in bitmap but used nowhere in inodes
-    if (!inuse[i] && mark[i]) {
-      fprintf(stderr, "ERROR: inode marked use but not found in directory.\n");
+    ref[e->inum]++;
+    if (ip->type == T_FILE && ref[e->inum] > ip->nlink) {
+      fprintf(stderr, "ERROR: bad reference count for file.\n");
+      exit(1);
+    }
+    if (ip->type == T_DIR && ref[e->inum] != 1) {
+      fprintf(stderr, "ERROR: directory appears more than once in filesystem.\n");
       exit(1);
     }
   }
 }
 
 /**
- * @brief [11] Reference counts(number of links) for regular files match the number of times file is
- *             referred to in directories (i.e., hard links work correctly)
+ * @brief Check every block of sampled directory dinum
  */
 void 
-valid_ref_count()
+sample_directory(uint dinum)
 {
-  // counter for links to inodes
-  uint* link = (uint*) malloc(sizeof(uint) * sb->ninodes);
-  // counter for references to inodes in mapping
-  uint* ref = (uint*) malloc(sizeof(uint) * sb->ninodes);
+  struct dinode* ip = inode(dinum);
+  int dots = 0;
+  uint k;
 
-  for (i = ROOTINO, dip = inode(i); i < sb->ninodes; i++, dip++) 
+  // packed images inflate a directory's blocks only once it is sampled
+  for (k = 0; k < NDIRECT; k++)
+    want_block(ip->addrs[k]);
+  if (ip->addrs[NDIRECT]) {
+    uint* addrs = (uint*) (addr + ip->addrs[NDIRECT] * BLOCK_SIZE);
+    for (k = 0; k < NINDIRECT; k++)
+      want_block(addrs[k]);
+  }
+  inflate_wanted();
+
+  for (k = 0; k < NDIRECT; k++) 
   {
-    if (dip && dip->type) 
+    if (ip->addrs[k]) {
+      sample_dir_block(dinum, ip->addrs[k], &dots);
+      seenblocks++;
+    }
+  }
+  if (ip->addrs[NDIRECT]) {
+    uint* addrs = (uint*) (addr + ip->addrs[NDIRECT] * BLOCK_SIZE);
+    for (k = 0; k < NINDIRECT; k++) 
     {
-      // counts only links to file
-      if (dip->type == T_FILE) 
-        link[i] += dip->nlink; // update link count
-      // count references in directory mappings
-      if (dip->type == T_DIR) 
-      {
-        for (n = 0; n < NDIRECT; n++) 
-        {
-          if ((blocknum = dip->addrs[n]) != 0)
-          {
-            de = (struct dirent *) (addr + blocknum*BLOCK_SIZE);
-            for (j = 0; j < DIRENTPB; j++,de++){
-              if (!de || strcmp(".", de->name) == 0 || strcmp("..", de->name) == 0)
-                continue;
-              ref[de->inum]++; // update reference count
-            }
-          }
-        }
-        if ((blocknum = dip->addrs[NDIRECT]) != 0) 
-        {
-          uint* addrs = (uint*) (addr + blocknum * BLOCK_SIZE);
-          for (n = 0; n < NINDIRECT; n++) 
-          {
-            if ((blocknum = addrs[n]) != 0)
-            {
-              de = (struct dirent *) (addr + blocknum*BLOCK_SIZE);
-              for (j = 0; j < DIRENTPB; j++,de++){
-                if (!de || strcmp(".", de->name) == 0 || strcmp("..", de->name) == 0)
-                  continue;
-                ref[de->inum]++; // update reference count
-              }
-            }
-          }
-        }
+      if (addrs[k]) {
+        sample_dir_block(dinum, addrs[k], &dots);
+        seenblocks++;
       }
     }
   }
+  if (dots != 2) {
+    fprintf(stderr, "ERROR: directory not properly formatted.\n");
+    exit(1);
+  }
+}
+
+/**
+ * @brief Once every directory has been sampled the reference counts are complete, so the
+ *        checks that need the whole namespace can be decided exactly
+ *        [9] every inode in use is referred to by some directory
+ *        [11] every file is referred to exactly as often as its link count
+ */
+void 
+sample_complete()
+{
+  for (i = ROOTINO + 1, dip = inode(i); i < sb->ninodes; i++, dip++) 
+  {
+    if (dip->type && ref[i] == 0) {
+      fprintf(stderr, "ERROR: inode marked use but not found in directory.\n");
+      exit(1);
+    }
+  }
   for (i = ROOTINO, dip = inode(i); i < sb->ninodes; i++, dip++) 
   {
-    // check for mismatch in link count and reference count
-    if (dip && dip->type && dip->type == T_FILE && ref[i] != link[i]) 
-    {
+    if (dip->type == T_FILE && ref[i] != dip->nlink) {
       fprintf(stderr, "ERROR: bad reference count for file.\n");
       exit(1);
     }
@@ -482,94 +824,163 @@ valid_ref_count()
 }
 
 /**
- * @brief [12] No extra links allowed for directories (each directory only appears in one other
- *        directory)
+ * @brief Budgeted fast check: [4] and [9]-[12] on directories sampled in seeded random order
+ *        until deadline (ms on the monotonic clock), then report coverage and, per condition,
+ *        the probability that a fault would have been found
+ * @return true if every directory was sampled
  */
-void 
-valid_dir_links()
+bool 
+valid_sampled(double deadline)
 {
-  // count references of directory
-  uint* count = (uint*) malloc(sizeof(uint) * sb->ninodes);
-  // flag whether an inode is directory or not
-  bool* isdir = (bool*) malloc(sizeof(bool) * sb->ninodes);
-  for (i = ROOTINO, dip = inode(i); i < sb->ninodes; i++, dip++) 
-  {
-    isdir[i] = false;
-    if (dip && dip->type && dip->type == T_DIR)  // mark isdir as true
-      isdir[i] = true; 
+  sample_init();
+  while (sampled < ndirs && now_ms() < deadline)
+    sample_directory(dirs[sampled++]);
+  if (sampled == ndirs)
+    sample_complete();
+
+  printf("sampled %u/%u directories, %u/%u directory blocks (%.1f%%)%s\n", sampled, ndirs,
+         seenblocks, dirblocks, dirblocks ? 100.0 * seenblocks / dirblocks : 100.0,
+         sampled == ndirs ? " (complete)" : "");
+  if (sampled == ndirs) {
+    printf("confidence 100.0%% for conditions 4, 9-12\n");
+    return true;
   }
-  for (i = ROOTINO, dip = inode(i); i < sb->ninodes; i++, dip++) 
+
+  // a fault in one directory is seen once that directory is sampled, a fault spread over
+  // two directories only once both are, and the rest only once all of them are
+  double one = 100.0 * sampled / ndirs;
+  double two = ndirs < 2 ? 0.0 : 100.0 * sampled * ((double) sampled - 1) / ((double) ndirs * (ndirs - 1));
+  printf("confidence %.1f%% for conditions 4, 10 (fault in one directory)\n", one);
+  printf("confidence %.1f%% for conditions 11 with more references than links, 12\n", two);
+  printf("not checked: conditions 9, 11 with fewer references than links\n");
+  return false;
+}
+
+
+/**
+ * @brief Run the conditions in checks in their usual order. Always inlined, as are the passes
+ *        it calls, so every call with a constant set compiles into a pipeline that allocates
+ *        and traverses only what the selected checks need.
+ */
+static inline __attribute__((always_inline)) void 
+run_checks(const uint checks)
+{
+  uint* ref = NULL;
+  bool badref = false;
+  if (checks & CHECK(1))
+    valid_inode();             // check for valid inodes
+  if (checks & CHECK(2))
+    valid_inode_blocks();      // validate each block address referred in inodes
+  if (checks & CHECK(3))
+    valid_root();              // validate the contents and existence of root directory
+  if (checks & CHECKS_NAMES)
+    ref = scan_names(checks, &badref);  // validate ".",".." entry points and count references
+  if (checks & CHECKS_BLOCKS)
+    valid_blocks(checks);      // validate block bitmap and that block addresses are not repeated
+  if (checks & CHECKS_REFS)
+    valid_names(checks, ref, badref);  // validate references to inodes found in directories
+}
+
+/**
+ * @return set of conditions in a list like "5-8,11", or 0 if it is malformed
+ */
+uint 
+parse_checks(char* list)
+{
+  uint checks = 0;
+  long lo, hi;
+  char* end;
+  for (;;) 
   {
-    if (dip && dip->type && dip->type == T_DIR) 
-    {
-      for (n = 0; n < NDIRECT; n++) 
-      {
-        if ((blocknum = dip->addrs[n]) != 0)
-        {
-          de = (struct dirent *) (addr + blocknum*BLOCK_SIZE);
-          for (j = 0; j < DIRENTPB; j++,de++){
-            if (!de || strcmp(".", de->name) == 0 || strcmp("..", de->name) == 0)
-              continue;
-            if (isdir[de->inum]) {
-              count[de->inum]++;
-              if (count[de->inum] != 1)  // a directory should be mapped only once throughout fs
-              {
-                fprintf(stderr, "ERROR: directory appears more than once in filesystem.\n");
-                exit(1);
-              }
-            }
-          }
-        }
-      }
-      if ((blocknum = dip->addrs[NDIRECT]) != 0) 
-      {
-        uint* addrs = (uint*) (addr + blocknum * BLOCK_SIZE);
-        for (n = 0; n < NINDIRECT; n++) 
-        {
-          if ((blocknum = addrs[n]) != 0)
-          {
-            de = (struct dirent *) (addr + blocknum*BLOCK_SIZE);
-            for (j = 0; j < DIRENTPB; j++,de++) {
-              if (!de || strcmp(".", de->name) == 0 || strcmp("..", de->name) == 0)
-                continue;
-              if (isdir[de->inum]) {
-                count[de->inum]++;
-                if (count[de->inum] != 1)  // a directory should be mapped only once throughout fs
-                {
-                  fprintf(stderr, "ERROR: directory appears more than once in filesystem.\n");
-                  exit(1);
-                }
-              }
-            }
-          }
-        }
-      }
+    lo = hi = strtol(list, &end, 10);
+    if (end == list)
+      return 0;
+    if (*end == '-') {
+      list = end + 1;
+      hi = strtol(list, &end, 10);
+      if (end == list)
+        return 0;
     }
+    if (lo < 1 || hi > 12 || lo > hi)
+      return 0;
+    for (; lo <= hi; lo++)
+      checks |= CHECK(lo);
+    if (*end == '\0')
+      return checks;
+    if (*end != ',')
+      return 0;
+    list = end + 1;
   }
 }
 
-
 /** Main */
 int
 main(int argc, char *argv[])
 {
-  // check arguments
-  if(argc < 2){
-    fprintf(stderr, "Usage: fcheck <file_system_image>\n");
+  double start = now_ms();
+  long budget = -1;  // milliseconds, negative for a full check
+  bool seeded = false;
+  uint only = CHECKS_ALL, skip = 0;  // selected conditions
+  char* image = NULL;
+  char* end;
+
+  // parse arguments
+  for (i = 1; i < argc; i++) 
+  {
+    if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+      budget = strtol(argv[++i], &end, 10);
+      if (*argv[i] == '\0' || *end != '\0' || budget < 0)
+        image = NULL, i = argc; // malformed budget, fall through to usage
+    }
+    else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      seed = strtoull(argv[++i], &end, 10);
+      seeded = true;
+      if (*argv[i] < '0' || *argv[i] > '9' || *end != '\0')
+        image = NULL, i = argc; // malformed seed, fall through to usage
+    }
+    else if (strcmp(argv[i], "--only") == 0 && i + 1 < argc)
+      only = parse_checks(argv[++i]);
+    else if (strcmp(argv[i], "--skip") == 0 && i + 1 < argc) {
+      skip = parse_checks(argv[++i]);
+      if (!skip)
+        skip = CHECKS_ALL; // malformed list, fall through to usage
+    }
+    else if (!image && argv[i][0] != '-')
+      image = argv[i];
+    else
+      image = NULL, i = argc;
+  }
+  uint checks = only & ~skip;
+  if(!image || (budget < 0 && seeded) || !checks || (budget >= 0 && checks != CHECKS_ALL)){
+    fprintf(stderr, "Usage: fcheck [--only <conditions>] [--skip <conditions>] <file_system_image>\n"
+                    "       fcheck --budget <ms> [--seed <n>] <file_system_image>\n");
     exit(1);
   }
   
-  init(argv[1]);             // initialize the checker
-  valid_inode();             // check for valid inodes
-  valid_inode_blocks();      // validate each block address referred in inodes
-  valid_root();              // validate the contents and existence of root directory
-  valid_directory();         // validate the properties of directory i.e ".",".." entry points
-  valid_bitmap_mark();       // validate block bitmap with blocks allocated in inode 
-  valid_direct_address();    // validate whether block addresses used in direct blocks are not repeated
-  valid_indirect_address();  // validate whether block addresses used in indirect blocks are not repeated
-  valid_inode_mark();        // validate the refernces provided in inode mapping and actual inode allocation
-  valid_ref_count();         // validate references associated with inodes with mapping
-  valid_dir_links();         // make sure directories do not have more than link
+  init(image, checks, budget >= 0);  // initialize the checker
+  if (budget >= 0) {
+    if (!seeded)
+      seed = (unsigned long long) time(NULL) ^ ((unsigned long long) getpid() << 32);
+    printf("seed %llu\n", seed);
+    fflush(stdout);
+    valid_superblock();      // make sure the layout fits in the image
+    valid_inode();           // check for valid inodes
+    valid_inode_blocks();    // validate each block address referred in inodes
+    valid_root();            // validate the contents and existence of root directory
+    valid_blocks(CHECKS_BLOCKS);  // validate block bitmap and that block addresses are not repeated
+    // sample directories for the namespace checks, a clean but partial run exits with 2
+    return valid_sampled(start + budget) ? 0 : 2;
+  }
+  // common sets get their own specialized pipeline, anything else runs the generic one
+  switch (checks) {
+    case CHECKS_ALL:    run_checks(CHECKS_ALL); break;
+    case CHECKS_INODES: run_checks(CHECKS_INODES); break;
+    case CHECKS_BLOCKS: run_checks(CHECKS_BLOCKS); break;
+    case CHECKS_NAMES:  run_checks(CHECKS_NAMES); break;
+    case CHECKS_INODES | CHECKS_BLOCKS: run_checks(CHECKS_INODES | CHECKS_BLOCKS); break;
+    case CHECKS_INODES | CHECKS_NAMES:  run_checks(CHECKS_INODES | CHECKS_NAMES); break;
+    case CHECKS_BLOCKS | CHECKS_NAMES:  run_checks(CHECKS_BLOCKS | CHECKS_NAMES); break;
+    default:            run_checks(checks); break;
+  }
   return 0;
 }
-
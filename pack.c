@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <stdbool.h>
+#include "types.h"
+#include "fs.h"
+#include "chunk.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/**
+ * Pack a file system image into independently compressed chunks that fcheck
+ * can read directly.
+ */
+
+/** MACROS */
+#define BLOCK_SIZE (BSIZE) // Block size of FS
+
+/**
+ * @brief Write n bytes of buf to fd at offset off
+ */
+void
+write_at(int fd, const void* buf, size_t n, off_t off)
+{
+  if (pwrite(fd, buf, n, off) != (ssize_t) n) {
+    perror("write failed");
+    exit(1);
+  }
+}
+
+/** Main */
+int
+main(int argc, char *argv[])
+{
+  struct chunkhdr hdr;
+  struct chunkent* index;
+  uint k, chunkblocks = CHUNK_BLOCKS;
+  int argi = 1;
+
+  // check arguments
+  if (argc == 5 && strcmp(argv[1], "-c") == 0) {
+    chunkblocks = atoi(argv[2]);
+    argi = 3;
+  }
+  if (argc - argi != 2 || chunkblocks == 0 || chunkblocks > CHUNK_MAXBLOCKS) {
+    fprintf(stderr, "Usage: pack [-c <blocks per chunk>] <file_system_image> <packed_image>\n");
+    exit(1);
+  }
+
+  // open and memory map the image
+  int fsfd = open(argv[argi], O_RDONLY);
+  if (fsfd < 0) {
+    fprintf(stderr, "image not found.\n");
+    exit(1);
+  }
+  struct stat buf;
+  if (fstat(fsfd, &buf) != 0) {
+    fprintf(stderr, "fstat failed.\n");
+    exit(1);
+  }
+  if (buf.st_size == 0 || (buf.st_size + BLOCK_SIZE - 1) / BLOCK_SIZE > 0xFFFFFFFFu) {
+    fprintf(stderr, "image size not supported.\n");
+    exit(1);
+  }
+  uchar* addr = mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fsfd, 0);
+  if (addr == MAP_FAILED) {
+    perror("mmap failed");
+    exit(1);
+  }
+
+  int outfd = open(argv[argi + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (outfd < 0) {
+    perror(argv[argi + 1]);
+    exit(1);
+  }
+
+  hdr.magic = CHUNK_MAGIC;
+  hdr.chunkblocks = chunkblocks;
+  hdr.nblocks = (buf.st_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  hdr.nchunks = (hdr.nblocks + chunkblocks - 1) / chunkblocks;
+  index = (struct chunkent*) calloc(hdr.nchunks, sizeof(struct chunkent));
+
+  uint chunkbytes = chunkblocks * BLOCK_SIZE;
+  uchar* raw = (uchar*) malloc(chunkbytes);
+  uchar* packed = (uchar*) malloc(chunkbytes);
+  off_t off = sizeof(hdr) + (off_t) hdr.nchunks * sizeof(struct chunkent);
+  uchar zero[BLOCK_SIZE] = {0};
+
+  for (k = 0; k < hdr.nchunks; k++)
+  {
+    // last chunk is padded with zeros up to a whole block
+    off_t start = (off_t) k * chunkbytes;
+    uint len = (hdr.nblocks - k * chunkblocks < chunkblocks ? hdr.nblocks - k * chunkblocks : chunkblocks) * BLOCK_SIZE;
+    uint have = buf.st_size - start < len ? buf.st_size - start : len;
+    memset(raw, 0, len);
+    memcpy(raw, addr + start, have);
+
+    // all zero chunks take no space, incompressible ones are stored as is
+    uint b;
+    for (b = 0; b < len && memcmp(raw + b, zero, BLOCK_SIZE) == 0; b += BLOCK_SIZE)
+      ;
+    index[k].off = off;
+    if (b == len) {
+      index[k].len = 0;
+      continue;
+    }
+    uint n = chunk_compress(raw, len, packed, len - 1);
+    if (n == 0) {
+      write_at(outfd, raw, len, off);
+      index[k].len = len;
+    } else {
+      write_at(outfd, packed, n, off);
+      index[k].len = n;
+    }
+    off += index[k].len;
+  }
+  write_at(outfd, &hdr, sizeof(hdr), 0);
+  write_at(outfd, index, (size_t) hdr.nchunks * sizeof(struct chunkent), sizeof(hdr));
+  if (close(outfd) != 0) {
+    perror("close failed");
+    exit(1);
+  }
+  printf("packed %u blocks into %u chunks, %lld -> %lld bytes\n", hdr.nblocks, hdr.nchunks,
+         (long long) buf.st_size, (long long) off);
+  return 0;
+}